@@ -0,0 +1,554 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <thread>
+#include <variant>
+#include <vector>
+#include "cpuEval.hpp"
+#include "piCalc/mathEngine/expr.hpp"
+#include "piCalc/mathEngine/simplify.hpp"
+#include "piCalc/mathEngine/simplifications/evaluateDerivatives.hpp"
+
+/******************************************************************************
+ *
+ * Analysis engine: roots, extrema and intersections of the entries
+ *
+ * Entries are compiled once (by whichever thread owns the piCalc expression
+ * trees, the symbolic worker in the gui) into cpuEval programs.  After that
+ * everything runs on a thread pool: the analysed x range is split into
+ * chunks, each chunk is sampled in batch, and every sign change is refined
+ * with a safeguarded Newton/bisection step.  Results are cached per
+ * (entry set, view cell), so panning around mostly just hits the cache.
+ *
+ * Nothing in here depends on ImGui or OpenGL, so it can be used headlessly.
+ *
+******************************************************************************/
+
+namespace analysis{
+
+class threadPool{
+public:
+    explicit threadPool(unsigned int threadCount = std::thread::hardware_concurrency()){
+#if defined(__EMSCRIPTEN__) && !defined(__EMSCRIPTEN_PTHREADS__)
+        threadCount = 0; //no threads available, tasks are run inline in submit()
+#endif
+        for(unsigned int i=0;i<threadCount;i++)
+            workers.emplace_back([this]{ workerLoop(); });
+    }
+
+    ~threadPool(){
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for(auto& worker : workers)
+            worker.join();
+    }
+
+    threadPool(const threadPool&) = delete;
+    threadPool& operator=(const threadPool&) = delete;
+
+    void submit(std::function<void()> task){
+        if(workers.empty()){
+            task();
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            tasks.push_back(std::move(task));
+        }
+        wake.notify_one();
+    }
+
+    unsigned int size() const{ return workers.size(); }
+private:
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> tasks;
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping = false;
+
+    void workerLoop(){
+        while(true){
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [this]{ return stopping || !tasks.empty(); });
+                if(stopping)
+                    return;
+                task = std::move(tasks.front());
+                tasks.pop_front();
+            }
+            task();
+        }
+    }
+};
+
+// One entry, compiled for the cpu
+struct curve{
+    unsigned int entryIndex; //1 based, matches the "entry N" label in the gui
+    bool isImplicit; //false: y = f(x), true: F(x, y) = 0
+    cpuEval::program f;
+    std::optional<cpuEval::program> dfdx = std::nullopt;
+    std::optional<cpuEval::program> d2fdx2 = std::nullopt; //explicit curves only
+    std::optional<cpuEval::program> dfdy = std::nullopt; //implicit curves only
+};
+
+inline std::optional<std::shared_ptr<mathEngine::expr>> simplifiedDerivative(const std::shared_ptr<mathEngine::expr>& expr, const std::string& var){
+    auto derivativeTry = mathEngine::simplification::evaluateDerivative(expr->clone(), var);
+    if(!derivativeTry)
+        return std::nullopt;
+    return mathEngine::fullySimplify(*derivativeTry);
+}
+
+inline std::optional<cpuEval::program> compileExpr(const std::shared_ptr<mathEngine::expr>& expr, const std::vector<std::string>& vars){
+    return cpuEval::compile(expr->toCode(vars), vars);
+}
+
+// Uses the same variables as genFragShader(): exprs only get x, equations get x and y.
+// xDerivative is simplifiedDerivative(expr, "x") for exprs, so a caller that already has it (the shader needs it too) can pass it in.
+// It is unused for equations.
+inline std::optional<curve> compileCurve(unsigned int entryIndex, const std::variant<mathEngine::equation, std::shared_ptr<mathEngine::expr>>& reducedEq, const std::optional<std::shared_ptr<mathEngine::expr>>& xDerivative){
+    if(std::holds_alternative<std::shared_ptr<mathEngine::expr>>(reducedEq)){
+        const std::vector<std::string> vars = {"x"};
+        const auto& expr = std::get<std::shared_ptr<mathEngine::expr>>(reducedEq);
+        auto f = compileExpr(expr, vars);
+        if(!f)
+            return std::nullopt;
+        curve output{entryIndex, false, std::move(*f)};
+        if(xDerivative){
+            output.dfdx = compileExpr(*xDerivative, vars);
+            auto secondDerivative = simplifiedDerivative(*xDerivative, "x");
+            if(secondDerivative)
+                output.d2fdx2 = compileExpr(*secondDerivative, vars);
+        }
+        return output;
+    }else{
+        const std::vector<std::string> vars = {"x", "y"};
+        std::shared_ptr<mathEngine::expr> diff = std::get<mathEngine::equation>(reducedEq).getDiff();
+        auto f = compileExpr(diff, vars);
+        if(!f)
+            return std::nullopt;
+        curve output{entryIndex, true, std::move(*f)};
+        auto dx = simplifiedDerivative(diff, "x");
+        if(dx)
+            output.dfdx = compileExpr(*dx, vars);
+        auto dy = simplifiedDerivative(diff, "y");
+        if(dy)
+            output.dfdy = compileExpr(*dy, vars);
+        return output;
+    }
+}
+
+inline std::optional<curve> compileCurve(unsigned int entryIndex, const std::variant<mathEngine::equation, std::shared_ptr<mathEngine::expr>>& reducedEq){
+    std::optional<std::shared_ptr<mathEngine::expr>> xDerivative = std::nullopt;
+    if(std::holds_alternative<std::shared_ptr<mathEngine::expr>>(reducedEq))
+        xDerivative = simplifiedDerivative(std::get<std::shared_ptr<mathEngine::expr>>(reducedEq), "x");
+    return compileCurve(entryIndex, reducedEq, xDerivative);
+}
+
+enum class markerType{
+    root,
+    extremum,
+    intersection
+};
+
+struct marker{
+    markerType type;
+    double x, y;
+    unsigned int entryA;
+    unsigned int entryB = 0; //only for intersections
+};
+
+struct viewRect{
+    double xStart, yStart;
+    double width, height;
+};
+
+struct result{
+    std::vector<marker> markers;
+    double xStart, xEnd; //the range that was analysed (always covers the requested view)
+    double computeMs;
+};
+
+// Safeguarded Newton: steps that stay inside the bracket are taken, anything else falls back to bisection.
+// df may return NaN if no derivative is known, which just means bisecting.
+template<typename F, typename D>
+double refineRoot(const F& f, const D& df, double a, double b, double fa, double tolerance){
+    double x = 0.5 * (a + b);
+    for(int i=0;i<100;i++){
+        double fx = f(x);
+        if(fx == 0.0)
+            return x;
+        if((fx < 0.0) == (fa < 0.0)){
+            a = x;
+            fa = fx;
+        }else{
+            b = x;
+        }
+        double next = x - fx / df(x);
+        if(!std::isfinite(next) || next <= a || next >= b)
+            next = 0.5 * (a + b);
+        if(std::abs(next - x) <= tolerance || b - a <= tolerance)
+            return next;
+        x = next;
+    }
+    return x;
+}
+
+// Calls emit(x) for every root of f found between consecutive samples.
+// Samples that are exactly 0 only count when they are isolated (a span that is identically 0, like the derivative
+// of a constant, has no meaningful roots) and either f changes sign across them, or acceptTouching is set
+// (a touching root is still a root of f, but a touching root of f' is an inflection point, not an extremum).
+// The first and last sample have no neighbour on one side, so chunks are overlapped by a sample to cover them.
+// Every candidate also has to pass isValid(x, a, b, fa, fb), where [a, b] is the bracket it was found in.
+template<typename F, typename D, typename V, typename E>
+void findRoots(const std::vector<double>& xs, const std::vector<double>& samples, const F& f, const D& df, double tolerance, bool acceptTouching, const V& isValid, const E& emit){
+    for(size_t i=0;i+1<xs.size();i++){
+        double s0 = samples[i];
+        double s1 = samples[i+1];
+        if(s0 == 0.0){
+            if(i == 0)
+                continue;
+            double before = samples[i-1];
+            if(before == 0.0 || s1 == 0.0 || !std::isfinite(before) || !std::isfinite(s1))
+                continue;
+            if((acceptTouching || (before < 0.0) != (s1 < 0.0)) && isValid(xs[i], xs[i-1], xs[i+1], before, s1))
+                emit(xs[i]);
+            continue;
+        }
+        if(!std::isfinite(s0) || !std::isfinite(s1) || (s0 < 0.0) == (s1 < 0.0) || s1 == 0.0)
+            continue;
+        double x = refineRoot(f, df, xs[i], xs[i+1], s0, tolerance);
+        if(isValid(x, xs[i], xs[i+1], s0, s1))
+            emit(x);
+    }
+}
+
+// isValid for roots of f itself (roots and intersections).  A sign change across a pole (e.g. 1/x) or a jump
+// (e.g. floor(x)-0.5) isn't a root: at a real root the refined value is tiny compared to the samples around it,
+// at a discontinuity it stays on the order of them (or grows)
+template<typename F>
+auto isRootOf(const F& f){
+    return [&f](double x, double, double, double fa, double fb){ return std::abs(f(x)) <= 1e-6 * (std::abs(fa) + std::abs(fb)); };
+}
+
+// isValid for extrema, found as roots of f'.  f' itself may jump at a real extremum (a cusp, like abs(x)), so
+// what gets checked is that f is continuous over the bracket: it can't move further than the slopes at the
+// bracket ends allow
+template<typename F>
+auto isExtremumOf(const F& f){
+    return [&f](double x, double a, double b, double dfa, double dfb){
+        double fx = f(x);
+        double allowed = 4.0 * std::max(std::abs(dfa), std::abs(dfb)) * (b - a) + 1e-12 * (1.0 + std::abs(fx));
+        return std::abs(fx - f(a)) <= allowed && std::abs(fx - f(b)) <= allowed;
+    };
+}
+
+struct curveSet{
+    std::vector<curve> curves;
+};
+
+// Analyses samples [first, last] of the window, appending to out
+inline void analyzeChunk(const curveSet& set, double xStart, double dx, size_t first, size_t last, std::vector<marker>& out){
+    const size_t n = last - first + 1;
+    const double tolerance = dx * 1e-9;
+    std::vector<double> xs(n);
+    for(size_t i=0;i<n;i++)
+        xs[i] = xStart + (first + i) * dx;
+    const double* xColumn = xs.data();
+    const auto nan = [](double){ return std::numeric_limits<double>::quiet_NaN(); };
+    const auto finiteDifference = [&](const cpuEval::program& p){
+        return [&p, h = dx * 1e-3](double x){ return (p.evaluate(x + h) - p.evaluate(x - h)) / (2.0 * h); };
+    };
+
+    const auto& curves = set.curves;
+    std::vector<std::vector<double>> values(curves.size());
+    std::vector<double> zeros(n, 0.0);
+    for(size_t c=0;c<curves.size();c++){
+        values[c].resize(n);
+        if(curves[c].isImplicit){
+            const double* columns[2] = {xColumn, zeros.data()};
+            curves[c].f.evaluateBatch(columns, values[c].data(), n);
+        }else{
+            curves[c].f.evaluateBatch(&xColumn, values[c].data(), n);
+        }
+    }
+
+    std::vector<double> scratch(n);
+    for(size_t c=0;c<curves.size();c++){
+        const auto& cur = curves[c];
+        if(cur.isImplicit){
+            //roots: F(x, 0) = 0
+            const auto f = [&](double x){ return cur.f.evaluate(x, 0.0); };
+            const auto df = [&](double x){ return cur.dfdx ? cur.dfdx->evaluate(x, 0.0) : std::numeric_limits<double>::quiet_NaN(); };
+            findRoots(xs, values[c], f, df, tolerance, true, isRootOf(f), [&](double x){ out.push_back({markerType::root, x, 0.0, cur.entryIndex}); });
+            //extrema of implicit curves would need a 2d search, so they are left out
+            continue;
+        }
+
+        const auto f = [&](double x){ return cur.f.evaluate(x); };
+        const auto emitRoot = [&](double x){ out.push_back({markerType::root, x, 0.0, cur.entryIndex}); };
+        const auto emitExtremum = [&](double x){
+            double y = f(x);
+            if(!std::isfinite(y))
+                return;
+            out.push_back({markerType::extremum, x, y, cur.entryIndex});
+            //tangent roots (like x^2) have no sign change, but do show up as an extremum at y = 0
+            if(std::abs(y) <= tolerance)
+                emitRoot(x);
+        };
+        if(cur.dfdx){
+            const auto df = [&](double x){ return cur.dfdx->evaluate(x); };
+            findRoots(xs, values[c], f, df, tolerance, true, isRootOf(f), emitRoot);
+            cur.dfdx->evaluateBatch(&xColumn, scratch.data(), n);
+            if(cur.d2fdx2)
+                findRoots(xs, scratch, df, [&](double x){ return cur.d2fdx2->evaluate(x); }, tolerance, false, isExtremumOf(f), emitExtremum);
+            else
+                findRoots(xs, scratch, df, finiteDifference(*cur.dfdx), tolerance, false, isExtremumOf(f), emitExtremum);
+        }else{
+            //no symbolic derivative, so extrema come from a finite difference of f instead
+            const auto df = finiteDifference(cur.f);
+            findRoots(xs, values[c], f, df, tolerance, true, isRootOf(f), emitRoot);
+            for(size_t i=0;i<n;i++)
+                scratch[i] = df(xs[i]);
+            findRoots(xs, scratch, df, nan, tolerance, false, isExtremumOf(f), emitExtremum);
+        }
+    }
+
+    //intersections
+    for(size_t a=0;a<curves.size();a++){
+        for(size_t b=a+1;b<curves.size();b++){
+            const auto& curA = curves[a];
+            const auto& curB = curves[b];
+            if(curA.isImplicit && curB.isImplicit)
+                continue; //would need a 2d search as well
+            if(!curA.isImplicit && !curB.isImplicit){
+                for(size_t i=0;i<n;i++)
+                    scratch[i] = values[a][i] - values[b][i];
+                const auto g = [&](double x){ return curA.f.evaluate(x) - curB.f.evaluate(x); };
+                const auto dg = [&](double x){
+                    if(!curA.dfdx || !curB.dfdx)
+                        return std::numeric_limits<double>::quiet_NaN();
+                    return curA.dfdx->evaluate(x) - curB.dfdx->evaluate(x);
+                };
+                findRoots(xs, scratch, g, dg, tolerance, true, isRootOf(g), [&](double x){ out.push_back({markerType::intersection, x, curA.f.evaluate(x), curA.entryIndex, curB.entryIndex}); });
+            }else{
+                //F(x, f(x)) = 0, with d/dx = dF/dx + dF/dy * f'(x)
+                const auto& implicitCur = curA.isImplicit ? curA : curB;
+                const auto& explicitCur = curA.isImplicit ? curB : curA;
+                const auto& explicitValues = curA.isImplicit ? values[b] : values[a];
+                const double* columns[2] = {xColumn, explicitValues.data()};
+                implicitCur.f.evaluateBatch(columns, scratch.data(), n);
+                const auto g = [&](double x){ return implicitCur.f.evaluate(x, explicitCur.f.evaluate(x)); };
+                const auto dg = [&](double x){
+                    if(!implicitCur.dfdx || !implicitCur.dfdy || !explicitCur.dfdx)
+                        return std::numeric_limits<double>::quiet_NaN();
+                    double y = explicitCur.f.evaluate(x);
+                    return implicitCur.dfdx->evaluate(x, y) + implicitCur.dfdy->evaluate(x, y) * explicitCur.dfdx->evaluate(x);
+                };
+                findRoots(xs, scratch, g, dg, tolerance, true, isRootOf(g), [&](double x){ out.push_back({markerType::intersection, x, explicitCur.f.evaluate(x), curA.entryIndex, curB.entryIndex}); });
+            }
+        }
+    }
+}
+
+// Sorts markers and drops the duplicates that show up where chunks meet
+inline void mergeMarkers(std::vector<marker>& markers, double dx){
+    std::sort(markers.begin(), markers.end(), [](const marker& l, const marker& r){
+        if(l.type != r.type) return l.type < r.type;
+        if(l.entryA != r.entryA) return l.entryA < r.entryA;
+        if(l.entryB != r.entryB) return l.entryB < r.entryB;
+        return l.x < r.x;
+    });
+    auto last = std::unique(markers.begin(), markers.end(), [dx](const marker& l, const marker& r){
+        return l.type == r.type && l.entryA == r.entryA && l.entryB == r.entryB && std::abs(l.x - r.x) < dx * 0.5;
+    });
+    markers.erase(last, markers.end());
+}
+
+class engine{
+public:
+    // The analysed window is 3 cells wide (one cell margin on each side of the view), each cell being sampled this many times
+    static constexpr size_t samplesPerCell = 2048;
+    static constexpr size_t maxCacheEntries = 64;
+
+    explicit engine(unsigned int threadCount = std::thread::hardware_concurrency()) : pool(threadCount) {}
+
+    ~engine(){
+        //wait for in flight jobs, as they reference this
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [this]{ return pending.empty(); });
+    }
+
+    void setCurves(std::vector<curve> newCurves){
+        std::lock_guard<std::mutex> lock(mutex);
+        curves = std::make_shared<const curveSet>(curveSet{std::move(newCurves)});
+        generation++;
+        cache.clear();
+        cacheOrder.clear();
+        latest = nullptr;
+    }
+
+    // Never blocks (unless running without threads).  Returns the cached result for this view if there is one,
+    // otherwise schedules it and returns the newest result available, which still covers most of a panned view.
+    std::shared_ptr<const result> request(const viewRect& view){
+        std::unique_lock<std::mutex> lock(mutex);
+        if(!curves || curves->curves.empty())
+            return nullptr;
+        cacheKey key = keyFor(view);
+        wantedKey = key;
+        auto found = cache.find(key);
+        if(found != cache.end()){
+            latest = found->second;
+            return latest;
+        }
+        if(!pending.contains(key)){
+            pending.insert(key);
+            auto set = curves;
+            lock.unlock();
+            schedule(key, set);
+            lock.lock();
+            found = cache.find(key);
+            if(found != cache.end())
+                latest = found->second;
+        }
+        return latest;
+    }
+
+    // Blocking version of request(), for headless use.  Returns nullptr if the job was superseded by another
+    // request() or setCurves() before it finished
+    std::shared_ptr<const result> compute(const viewRect& view){
+        request(view);
+        std::unique_lock<std::mutex> lock(mutex);
+        if(!curves || curves->curves.empty())
+            return nullptr;
+        cacheKey key = keyFor(view);
+        done.wait(lock, [&]{ return cache.contains(key) || !pending.contains(key); });
+        auto found = cache.find(key);
+        return found != cache.end() ? found->second : nullptr;
+    }
+
+    unsigned int threadCount() const{ return pool.size(); }
+private:
+    struct cacheKey{
+        uint64_t generation;
+        int level; //cell width is 2^level
+        int64_t cell;
+        auto operator<=>(const cacheKey&) const = default;
+    };
+
+    struct job{
+        cacheKey key;
+        std::shared_ptr<const curveSet> set;
+        double xStart, dx;
+        std::vector<std::vector<marker>> chunks;
+        std::atomic<size_t> remaining;
+        std::atomic<bool> cancelled = false;
+        //per chunk, so computeMs covers the actual work and not the time spent waiting in the queue
+        std::vector<std::chrono::steady_clock::time_point> chunkStart, chunkEnd;
+    };
+
+    cacheKey keyFor(const viewRect& view) const{
+        int level = (int)std::ceil(std::log2(std::max(view.width, 1e-12)));
+        double cellWidth = std::ldexp(1.0, level);
+        return {generation, level, (int64_t)std::floor(view.xStart / cellWidth)};
+    }
+
+    void schedule(const cacheKey& key, std::shared_ptr<const curveSet> set){
+        const size_t sampleCount = samplesPerCell * 3;
+        const size_t chunkCount = std::max<size_t>(1, pool.size() * 4);
+        const size_t chunkSize = (sampleCount + chunkCount - 1) / chunkCount;
+        double cellWidth = std::ldexp(1.0, key.level);
+
+        auto newJob = std::make_shared<job>();
+        newJob->key = key;
+        newJob->set = std::move(set);
+        newJob->xStart = (key.cell - 1) * cellWidth;
+        newJob->dx = cellWidth * 3 / sampleCount;
+        newJob->chunks.resize(chunkCount);
+        newJob->remaining = chunkCount;
+        newJob->chunkStart.resize(chunkCount);
+        newJob->chunkEnd.resize(chunkCount);
+
+        for(size_t c=0;c<chunkCount;c++){
+            //chunks overlap by a sample on each side, so every sample (and every sign change between two)
+            //is seen with both of its neighbours by some chunk.  The duplicates are removed by mergeMarkers()
+            size_t first = std::min(c * chunkSize, sampleCount);
+            size_t last = std::min((c + 1) * chunkSize, sampleCount);
+            pool.submit([this, newJob, c, first, last, sampleCount]{
+                //views passed while panning/zooming, and entry sets replaced by setCurves(), shouldn't hold up the one on screen
+                if(!newJob->cancelled && !isWanted(newJob->key))
+                    newJob->cancelled = true;
+                newJob->chunkStart[c] = newJob->chunkEnd[c] = std::chrono::steady_clock::now();
+                if(!newJob->cancelled && first < last){
+                    analyzeChunk(*newJob->set, newJob->xStart, newJob->dx, first > 0 ? first - 1 : 0, std::min(last + 1, sampleCount), newJob->chunks[c]);
+                    newJob->chunkEnd[c] = std::chrono::steady_clock::now();
+                }
+                if(--newJob->remaining == 0)
+                    finish(*newJob);
+            });
+        }
+    }
+
+    bool isWanted(const cacheKey& key){
+        std::lock_guard<std::mutex> lock(mutex);
+        return key.generation == generation && wantedKey == key;
+    }
+
+    void finish(job& finished){
+        if(finished.cancelled){
+            std::lock_guard<std::mutex> lock(mutex);
+            pending.erase(finished.key);
+            done.notify_all();
+            return;
+        }
+        auto output = std::make_shared<result>();
+        for(auto& chunk : finished.chunks)
+            output->markers.insert(output->markers.end(), chunk.begin(), chunk.end());
+        mergeMarkers(output->markers, finished.dx);
+        output->xStart = finished.xStart;
+        output->xEnd = finished.xStart + finished.dx * samplesPerCell * 3;
+        auto start = *std::min_element(finished.chunkStart.begin(), finished.chunkStart.end());
+        auto end = *std::max_element(finished.chunkEnd.begin(), finished.chunkEnd.end());
+        output->computeMs = std::chrono::duration<double, std::milli>(end - start).count();
+
+        std::lock_guard<std::mutex> lock(mutex);
+        pending.erase(finished.key);
+        if(finished.key.generation == generation){
+            if(cache.size() >= maxCacheEntries){
+                cache.erase(cacheOrder.front());
+                cacheOrder.pop_front();
+            }
+            cache[finished.key] = output;
+            cacheOrder.push_back(finished.key);
+            latest = output;
+        }
+        done.notify_all();
+    }
+
+    std::mutex mutex;
+    std::condition_variable done;
+    std::shared_ptr<const curveSet> curves;
+    uint64_t generation = 0;
+    std::map<cacheKey, std::shared_ptr<const result>> cache;
+    std::deque<cacheKey> cacheOrder;
+    std::set<cacheKey> pending;
+    std::optional<cacheKey> wantedKey; //the view last passed to request()
+    std::shared_ptr<const result> latest;
+    threadPool pool; //declared last so its workers are joined before anything they use is destroyed
+};
+
+}
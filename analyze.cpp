@@ -0,0 +1,80 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include "analysisEngine.hpp"
+#include "piCalc/parser/ptParse/ptParse.hpp"
+#include "piCalc/mathEngine/exprs/exponent.hpp"
+
+/******************************************************************************
+ *
+ * Headless front end for the analysis engine, for scripted checks
+ *
+ * usage: piGraphAnalyze [--view xStart yStart width height] [--threads n] entry...
+ *
+ * Prints one marker per line: "<type> <entryA> <entryB> <x> <y>"
+ *
+******************************************************************************/
+
+int main(int argc, char* argv[])
+{
+    analysis::viewRect view = {-2.5, -2.5, 5.0, 5.0};
+    unsigned int threadCount = std::thread::hardware_concurrency();
+    std::vector<std::string> eqs;
+    for(int i=1;i<argc;i++){
+        std::string arg = argv[i];
+        if(arg == "--view" && i + 4 < argc){
+            view = {std::stod(argv[i+1]), std::stod(argv[i+2]), std::stod(argv[i+3]), std::stod(argv[i+4])};
+            i += 4;
+        }else if(arg == "--threads" && i + 1 < argc){
+            threadCount = std::stoul(argv[++i]);
+        }else{
+            eqs.push_back(arg);
+        }
+    }
+    if(eqs.empty()){
+        std::cerr<<"usage: "<<argv[0]<<" [--view xStart yStart width height] [--threads n] entry..."<<std::endl;
+        return 1;
+    }
+
+    //must match the gui, as the cpu programs are compiled from the same code as the shader
+    mathEngine::exprs::exponent::exponentCodeFuncName = "altPow";
+
+    std::vector<analysis::curve> curves;
+    for(unsigned int i=0;i<eqs.size();i++){
+        auto parsed = parser::ptParse::parse(eqs[i]);
+        if(!parsed){
+            std::cerr<<"Failed to parse entry "<<i+1<<": "<<eqs[i]<<std::endl;
+            return 1;
+        }
+        std::optional<analysis::curve> compiled;
+        if(std::holds_alternative<mathEngine::equation>(parsed->value))
+            compiled = analysis::compileCurve(i+1, mathEngine::fullySimplify(std::get<mathEngine::equation>(parsed->value).clone()));
+        else
+            compiled = analysis::compileCurve(i+1, mathEngine::fullySimplify(std::get<std::shared_ptr<mathEngine::expr>>(parsed->value)->clone()));
+        if(!compiled){
+            std::cerr<<"Failed to compile entry "<<i+1<<": "<<eqs[i]<<std::endl;
+            return 1;
+        }
+        curves.push_back(std::move(*compiled));
+    }
+
+    analysis::engine engine(threadCount);
+    engine.setCurves(std::move(curves));
+    auto result = engine.compute(view);
+    if(!result)
+        return 1;
+
+    std::cout.precision(12);
+    for(const auto& marker : result->markers){
+        if(marker.x < view.xStart || marker.x > view.xStart + view.width || marker.y < view.yStart || marker.y > view.yStart + view.height)
+            continue;
+        switch(marker.type){
+            case analysis::markerType::root: std::cout<<"root"; break;
+            case analysis::markerType::extremum: std::cout<<"extremum"; break;
+            case analysis::markerType::intersection: std::cout<<"intersection"; break;
+        }
+        std::cout<<" "<<marker.entryA<<" "<<marker.entryB<<" "<<marker.x<<" "<<marker.y<<std::endl;
+    }
+    std::cerr<<"analysed ["<<result->xStart<<", "<<result->xEnd<<"] in "<<result->computeMs<<" ms on "<<engine.threadCount()<<" threads"<<std::endl;
+    return 0;
+}
@@ -0,0 +1,104 @@
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "analysisEngine.hpp"
+#include "piCalc/parser/ptParse/ptParse.hpp"
+#include "piCalc/mathEngine/exprs/exponent.hpp"
+
+/******************************************************************************
+ *
+ * Headless benchmark of the cpu side (symbolic work, evaluation, analysis)
+ *
+ * Builds natively and with emscripten, where it runs under node:
+ *     node em_build/piGraphBench.js
+ * so the numbers of the two can be compared directly.
+ *
+ * usage: piGraphBench [--threads n] [entry...]
+ *
+******************************************************************************/
+
+using benchClock = std::chrono::steady_clock;
+
+static double msSince(benchClock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(benchClock::now() - start).count();
+}
+
+static std::optional<analysis::curve> compileEntry(unsigned int entryIndex, const std::string& eq)
+{
+    auto parsed = parser::ptParse::parse(eq);
+    if(!parsed)
+        return std::nullopt;
+    if(std::holds_alternative<mathEngine::equation>(parsed->value))
+        return analysis::compileCurve(entryIndex, mathEngine::fullySimplify(std::get<mathEngine::equation>(parsed->value).clone()));
+    return analysis::compileCurve(entryIndex, mathEngine::fullySimplify(std::get<std::shared_ptr<mathEngine::expr>>(parsed->value)->clone()));
+}
+
+int main(int argc, char* argv[])
+{
+    unsigned int threadCount = std::thread::hardware_concurrency();
+    std::vector<std::string> eqs;
+    for(int i=1;i<argc;i++){
+        std::string arg = argv[i];
+        if(arg == "--threads" && i + 1 < argc)
+            threadCount = std::stoul(argv[++i]);
+        else
+            eqs.push_back(arg);
+    }
+    if(eqs.empty())
+        eqs = {"sin(x)*x", "x^3-2*x", "1/x", "x^2+y^2=4", "cos(3*x)/(1+x^2)"};
+
+    mathEngine::exprs::exponent::exponentCodeFuncName = "altPow";
+
+    //parse + simplify + derivatives + compile, as done on the symbolic worker for every edit
+    const int symbolicRuns = 20;
+    std::vector<analysis::curve> curves;
+    auto start = benchClock::now();
+    for(int run=0;run<symbolicRuns;run++){
+        curves.clear();
+        for(unsigned int i=0;i<eqs.size();i++){
+            auto compiled = compileEntry(i+1, eqs[i]);
+            if(!compiled){
+                std::cerr<<"Failed to compile entry "<<i+1<<": "<<eqs[i]<<std::endl;
+                return 1;
+            }
+            curves.push_back(std::move(*compiled));
+        }
+    }
+    std::cout<<"symbolic: "<<msSince(start) / symbolicRuns<<" ms per entry set"<<std::endl;
+
+    //raw batch evaluation throughput
+    const size_t pointCount = 1 << 16;
+    const int evalRuns = 50;
+    std::vector<double> xs(pointCount), ys(pointCount), out(pointCount);
+    for(size_t i=0;i<pointCount;i++){
+        xs[i] = -10.0 + 20.0 * i / pointCount;
+        ys[i] = 0.5;
+    }
+    const double* columns[2] = {xs.data(), ys.data()};
+    double checksum = 0.0;
+    start = benchClock::now();
+    for(int run=0;run<evalRuns;run++){
+        for(const auto& cur : curves){
+            cur.f.evaluateBatch(columns, out.data(), pointCount);
+            checksum += out[run % pointCount];
+        }
+    }
+    double evalMs = msSince(start);
+    std::cout<<"batch eval: "<<(double)pointCount * evalRuns * curves.size() / (evalMs * 1e3)<<" Mpoints/s (checksum "<<checksum<<")"<<std::endl;
+
+    //analysis of a pan across the plane, every view landing in a new cell so nothing is cached
+    const int viewCount = 50;
+    analysis::engine engine(threadCount);
+    engine.setCurves(curves);
+    size_t markerCount = 0;
+    start = benchClock::now();
+    for(int i=0;i<viewCount;i++){
+        auto result = engine.compute({-100.0 + i * 8.0, -2.5, 5.0, 5.0});
+        if(result)
+            markerCount += result->markers.size();
+    }
+    std::cout<<"analysis: "<<msSince(start) / viewCount<<" ms per view on "<<engine.threadCount()<<" threads ("<<markerCount<<" markers)"<<std::endl;
+    return 0;
+}
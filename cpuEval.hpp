@@ -0,0 +1,367 @@
+#pragma once
+#include <cctype>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/******************************************************************************
+ *
+ * CPU evaluation of piCalc expressions
+ *
+ * The shader is built from expr::toCode(), so we compile that same code string
+ * into a flat stack program here.  That way the CPU evaluates the same
+ * expression the GPU draws, though in double rather than float precision and
+ * with the well defined altPow() below.  The compiled program never touches
+ * the expression tree, so it can be shared freely between threads.
+ *
+******************************************************************************/
+
+namespace cpuEval{
+
+// Like altPow() in the fragment shader, negative bases work for odd integer exponents.  The shader leaves every
+// other negative base case to glsl pow(), which is undefined there; here even integer exponents give the
+// mathematical result and non integer ones give NaN (as std::pow does)
+inline double altPow(double base, double exp){
+    if(base < 0.0){
+        double rounded = std::round(exp);
+        if(std::abs(rounded - exp) < 1e-7)
+            return std::pow(base, rounded);
+    }
+    return std::pow(base, exp);
+}
+
+// glsl mod() is floored, unlike std::fmod
+inline double glslMod(double x, double y){ return x - y * std::floor(x / y); }
+inline double glslSign(double x){ return (x > 0.0) - (x < 0.0); }
+inline double glslFract(double x){ return x - std::floor(x); }
+inline double glslMin(double a, double b){ return std::fmin(a, b); }
+inline double glslMax(double a, double b){ return std::fmax(a, b); }
+inline double glslAtan2(double y, double x){ return std::atan2(y, x); }
+inline double identity(double x){ return x; }
+
+using func1 = double(*)(double);
+using func2 = double(*)(double, double);
+
+inline func1 lookupFunc1(std::string_view name){
+    if(name == "sin") return [](double x){ return std::sin(x); };
+    if(name == "cos") return [](double x){ return std::cos(x); };
+    if(name == "tan") return [](double x){ return std::tan(x); };
+    if(name == "asin") return [](double x){ return std::asin(x); };
+    if(name == "acos") return [](double x){ return std::acos(x); };
+    if(name == "atan") return [](double x){ return std::atan(x); };
+    if(name == "sinh") return [](double x){ return std::sinh(x); };
+    if(name == "cosh") return [](double x){ return std::cosh(x); };
+    if(name == "tanh") return [](double x){ return std::tanh(x); };
+    if(name == "exp") return [](double x){ return std::exp(x); };
+    if(name == "exp2") return [](double x){ return std::exp2(x); };
+    if(name == "log") return [](double x){ return std::log(x); };
+    if(name == "log2") return [](double x){ return std::log2(x); };
+    if(name == "sqrt") return [](double x){ return std::sqrt(x); };
+    if(name == "abs") return [](double x){ return std::abs(x); };
+    if(name == "floor") return [](double x){ return std::floor(x); };
+    if(name == "ceil") return [](double x){ return std::ceil(x); };
+    if(name == "sign") return glslSign;
+    if(name == "fract") return glslFract;
+    if(name == "float") return identity;
+    return nullptr;
+}
+
+inline func2 lookupFunc2(std::string_view name){
+    if(name == "pow" || name == "altPow") return altPow;
+    if(name == "mod") return glslMod;
+    if(name == "min") return glslMin;
+    if(name == "max") return glslMax;
+    if(name == "atan") return glslAtan2;
+    return nullptr;
+}
+
+enum class opType : uint8_t{
+    constant,
+    variable,
+    neg,
+    add,
+    sub,
+    mul,
+    div,
+    call1,
+    call2
+};
+
+struct instruction{
+    opType op;
+    unsigned int varIndex = 0;
+    double value = 0.0;
+    func1 f1 = nullptr;
+    func2 f2 = nullptr;
+};
+
+struct program{
+    std::vector<instruction> code;
+    unsigned int varCount = 0;
+    unsigned int maxStack = 0;
+
+    // vars must hold varCount values, in the order given to compile()
+    double evaluate(const double* vars) const{
+        thread_local std::vector<double> stackStorage;
+        if(stackStorage.size() < maxStack)
+            stackStorage.resize(maxStack);
+        double* stack = stackStorage.data();
+        unsigned int top = 0;
+        for(const auto& ins : code){
+            switch(ins.op){
+                case opType::constant: stack[top++] = ins.value; break;
+                case opType::variable: stack[top++] = vars[ins.varIndex]; break;
+                case opType::neg: stack[top-1] = -stack[top-1]; break;
+                case opType::add: top--; stack[top-1] += stack[top]; break;
+                case opType::sub: top--; stack[top-1] -= stack[top]; break;
+                case opType::mul: top--; stack[top-1] *= stack[top]; break;
+                case opType::div: top--; stack[top-1] /= stack[top]; break;
+                case opType::call1: stack[top-1] = ins.f1(stack[top-1]); break;
+                case opType::call2: top--; stack[top-1] = ins.f2(stack[top-1], stack[top]); break;
+            }
+        }
+        return stack[0];
+    }
+
+    double evaluate(double x) const{ return evaluate(&x); }
+    double evaluate(double x, double y) const{ double vars[2] = {x, y}; return evaluate(vars); }
+
+    // Evaluates n points at once, one instruction at a time over the whole column
+    // varColumns[i] points to n values of variable i, and out receives n results
+    void evaluateBatch(const double* const* varColumns, double* out, size_t n) const{
+        thread_local std::vector<double> stackStorage;
+        if(stackStorage.size() < (size_t)maxStack * n)
+            stackStorage.resize((size_t)maxStack * n);
+        unsigned int top = 0;
+        const auto column = [&](unsigned int i){ return stackStorage.data() + (size_t)i * n; };
+        for(const auto& ins : code){
+            switch(ins.op){
+                case opType::constant:{
+                    double* dst = column(top++);
+                    for(size_t i=0;i<n;i++) dst[i] = ins.value;
+                    break;
+                }
+                case opType::variable:{
+                    double* dst = column(top++);
+                    const double* src = varColumns[ins.varIndex];
+                    for(size_t i=0;i<n;i++) dst[i] = src[i];
+                    break;
+                }
+                case opType::neg:{
+                    double* a = column(top-1);
+                    for(size_t i=0;i<n;i++) a[i] = -a[i];
+                    break;
+                }
+                case opType::add:{
+                    top--;
+                    double* a = column(top-1); const double* b = column(top);
+                    for(size_t i=0;i<n;i++) a[i] += b[i];
+                    break;
+                }
+                case opType::sub:{
+                    top--;
+                    double* a = column(top-1); const double* b = column(top);
+                    for(size_t i=0;i<n;i++) a[i] -= b[i];
+                    break;
+                }
+                case opType::mul:{
+                    top--;
+                    double* a = column(top-1); const double* b = column(top);
+                    for(size_t i=0;i<n;i++) a[i] *= b[i];
+                    break;
+                }
+                case opType::div:{
+                    top--;
+                    double* a = column(top-1); const double* b = column(top);
+                    for(size_t i=0;i<n;i++) a[i] /= b[i];
+                    break;
+                }
+                case opType::call1:{
+                    double* a = column(top-1);
+                    for(size_t i=0;i<n;i++) a[i] = ins.f1(a[i]);
+                    break;
+                }
+                case opType::call2:{
+                    top--;
+                    double* a = column(top-1); const double* b = column(top);
+                    for(size_t i=0;i<n;i++) a[i] = ins.f2(a[i], b[i]);
+                    break;
+                }
+            }
+        }
+        const double* result = column(0);
+        for(size_t i=0;i<n;i++) out[i] = result[i];
+    }
+};
+
+// Small recursive descent parser for the glsl subset that toCode() produces
+class compiler{
+public:
+    compiler(std::string_view src, const std::vector<std::string>& vars) : src(src), vars(vars) {}
+
+    std::optional<program> compile(){
+        prog.varCount = vars.size();
+        if(!parseSum())
+            return std::nullopt;
+        skipSpace();
+        if(pos != src.size())
+            return std::nullopt;
+        return prog;
+    }
+private:
+    std::string_view src;
+    const std::vector<std::string>& vars;
+    size_t pos = 0;
+    unsigned int depth = 0;
+    program prog;
+
+    void emit(instruction ins){
+        switch(ins.op){
+            case opType::constant:
+            case opType::variable:
+                depth++;
+                break;
+            case opType::add:
+            case opType::sub:
+            case opType::mul:
+            case opType::div:
+            case opType::call2:
+                depth--;
+                break;
+            default:
+                break;
+        }
+        if(depth > prog.maxStack)
+            prog.maxStack = depth;
+        prog.code.push_back(ins);
+    }
+
+    void skipSpace(){
+        while(pos < src.size() && std::isspace((unsigned char)src[pos]))
+            pos++;
+    }
+
+    bool accept(char c){
+        skipSpace();
+        if(pos < src.size() && src[pos] == c){
+            pos++;
+            return true;
+        }
+        return false;
+    }
+
+    bool parseSum(){
+        if(!parseProduct())
+            return false;
+        while(true){
+            if(accept('+')){
+                if(!parseProduct()) return false;
+                emit({opType::add});
+            }else if(accept('-')){
+                if(!parseProduct()) return false;
+                emit({opType::sub});
+            }else{
+                return true;
+            }
+        }
+    }
+
+    bool parseProduct(){
+        if(!parseUnary())
+            return false;
+        while(true){
+            if(accept('*')){
+                if(!parseUnary()) return false;
+                emit({opType::mul});
+            }else if(accept('/')){
+                if(!parseUnary()) return false;
+                emit({opType::div});
+            }else{
+                return true;
+            }
+        }
+    }
+
+    bool parseUnary(){
+        if(accept('-')){
+            if(!parseUnary()) return false;
+            emit({opType::neg});
+            return true;
+        }
+        if(accept('+'))
+            return parseUnary();
+        return parsePrimary();
+    }
+
+    bool parsePrimary(){
+        skipSpace();
+        if(pos >= src.size())
+            return false;
+        if(accept('(')){
+            if(!parseSum()) return false;
+            return accept(')');
+        }
+        char c = src[pos];
+        if(std::isdigit((unsigned char)c) || c == '.'){
+            std::string number(src.substr(pos));
+            char* end = nullptr;
+            double value = std::strtod(number.c_str(), &end);
+            if(end == number.c_str())
+                return false;
+            pos += end - number.c_str();
+            emit({opType::constant, 0, value});
+            return true;
+        }
+        if(std::isalpha((unsigned char)c) || c == '_'){
+            size_t start = pos;
+            while(pos < src.size() && (std::isalnum((unsigned char)src[pos]) || src[pos] == '_'))
+                pos++;
+            std::string_view name = src.substr(start, pos - start);
+            if(accept('('))
+                return parseCall(name);
+            for(unsigned int i=0;i<vars.size();i++){
+                if(vars[i] == name){
+                    emit({opType::variable, i});
+                    return true;
+                }
+            }
+            return false; //unknown variable
+        }
+        return false;
+    }
+
+    bool parseCall(std::string_view name){
+        unsigned int argCount = 0;
+        if(!accept(')')){
+            do{
+                if(!parseSum()) return false;
+                argCount++;
+            }while(accept(','));
+            if(!accept(')'))
+                return false;
+        }
+        if(argCount == 1){
+            auto f = lookupFunc1(name);
+            if(!f) return false;
+            emit({opType::call1, 0, 0.0, f});
+            return true;
+        }
+        if(argCount == 2){
+            auto f = lookupFunc2(name);
+            if(!f) return false;
+            emit({opType::call2, 0, 0.0, nullptr, f});
+            return true;
+        }
+        return false;
+    }
+};
+
+inline std::optional<program> compile(std::string_view code, const std::vector<std::string>& vars){
+    return compiler(code, vars).compile();
+}
+
+}
@@ -4,7 +4,12 @@ mkdir em_build
 cp -r piCalc em_build/piCalc
 cd em_build
 cd piCalc
-make static -j16 CC=emcc CXX=em++ AR=emar BUILD_CXX_FLAGS="-std=c++20 -O2"
+# -pthread is needed for everything linked into the (threaded) app
+make static -j16 CC=emcc CXX=em++ AR=emar BUILD_CXX_FLAGS="-std=c++20 -O2 -pthread"
 cd ..
 emcmake cmake .. -DCMAKE_BUILD_TYPE=Release
 make -j16
+
+# The threaded build uses SharedArrayBuffer, so the page has to be served cross-origin isolated
+# (headers "Cross-Origin-Opener-Policy: same-origin" and "Cross-Origin-Embedder-Policy: require-corp").
+# Benchmark against native with: node em_build/piGraphBench.js
@@ -1,11 +1,14 @@
 #include "hello_imgui/hello_imgui.h"
 #include "hello_imgui/hello_imgui_include_opengl.h"
 #include "shaderUtil.hpp"
+#include "analysisEngine.hpp"
 #include "imgui_stdlib.h"
 #include <iostream>
 #include <memory>
 #include <list>
 #include <algorithm>
+#include <mutex>
+#include <unordered_map>
 #include "piCalc/parser/ptParse/ptParse.hpp"
 #include "piCalc/mathEngine/expr.hpp"
 #include "piCalc/mathEngine/exprs/exponent.hpp"
@@ -145,50 +148,110 @@ void main(){
  *
 ******************************************************************************/
 
+using parsedEqType = std::variant<mathEngine::equation, std::shared_ptr<mathEngine::expr>>;
+
+// The shader code for one entry, up to (and including) the opening of the if that sets its color
+// xDerivative is the simplified d/dx of a single expr (unused for equations)
+std::string genEntryShaderCode(const parsedEqType& reducedEq, const std::optional<std::shared_ptr<mathEngine::expr>>& xDerivative, float graphThickness){
+	std::string codeEntry = "\t\tfloat val = ";
+	if(std::holds_alternative<mathEngine::equation>(reducedEq)){
+		codeEntry += std::get<mathEngine::equation>(reducedEq).getDiff()->toCode({"x", "y"}) + ";\n";
+		codeEntry += "\t\tif(abs(val) < EPSILON * " + std::to_string(graphThickness) + "){\n";
+	}else if(std::holds_alternative<std::shared_ptr<mathEngine::expr>>(reducedEq)){
+		auto& expr = std::get<std::shared_ptr<mathEngine::expr>>(reducedEq);
+		codeEntry += expr->toCode({"x"}) + ";\n"; //single exprs are treated as y=..., so no y terms allowed
+		if(xDerivative){
+			auto derivative = (*xDerivative)->toCode({"x"});
+			codeEntry += "\t\tif(abs(y-val) < EPSILON * " + std::to_string(graphThickness) + " * max(abs(" + derivative + "), 1.0) ){\n";//note.  this maybe should be rethought for functions where the derivative isn't asways defined, for example Dx 1/x = ln(x) isn't defined for x < 0
+		}else{
+			codeEntry += "\t\tif(abs(y-val) < EPSILON * " + std::to_string(graphThickness) + "){\n";
+		}
+	}else{
+		return {};
+	}
+	return codeEntry;
+}
+
+// Everything that has to be done with an entry's expression trees.  Runs on the symbolic worker thread
+// (a Web Worker on emscripten), so that typing into an entry doesn't block the frame.
+struct symbolicResult{
+	unsigned int entryId;
+	unsigned int revision;
+	std::optional<parsedEqType> parsedEq = std::nullopt;
+	std::optional<parsedEqType> reducedEq = std::nullopt;
+	std::string shaderCode;
+	std::optional<analysis::curve> curve = std::nullopt;
+};
+
+symbolicResult runSymbolic(unsigned int entryId, unsigned int revision, const std::string& entryText, float graphThickness){
+	symbolicResult output{entryId, revision};
+	auto parsed = parser::ptParse::parse(entryText);
+	if(!parsed)
+		return output;
+	output.parsedEq = parsed->value;
+	if(std::holds_alternative<mathEngine::equation>(*output.parsedEq)){
+		const auto& eq = std::get<mathEngine::equation>(*output.parsedEq);
+		output.reducedEq = mathEngine::fullySimplify(eq.clone());
+	}
+	if(std::holds_alternative<std::shared_ptr<mathEngine::expr>>(*output.parsedEq)){
+		const auto& eq = std::get<std::shared_ptr<mathEngine::expr>>(*output.parsedEq);
+		output.reducedEq = mathEngine::fullySimplify(eq->clone());
+	}
+	if(output.reducedEq){
+		//the derivative is needed by both the shader and the analysis curve, and is the expensive part
+		std::optional<std::shared_ptr<mathEngine::expr>> xDerivative = std::nullopt;
+		if(std::holds_alternative<std::shared_ptr<mathEngine::expr>>(*output.reducedEq))
+			xDerivative = analysis::simplifiedDerivative(std::get<std::shared_ptr<mathEngine::expr>>(*output.reducedEq), "x");
+		output.shaderCode = genEntryShaderCode(*output.reducedEq, xDerivative, graphThickness);
+		output.curve = analysis::compileCurve(0, *output.reducedEq, xDerivative);
+	}
+	return output;
+}
+
 // Our global app state
 struct AppState
 {
     GLuint ShaderProgram;     // the shader program that is compiled and linked at startup
+    GLuint VertexShader;      // the vertex shader, compiled once at startup and shared by every program
     GLuint FullScreenQuadVAO; // the VAO of a full-screen quad
     UniformsList Uniforms;    // the uniforms of the shader program, that enable to modify the shader parameters
+    std::optional<PendingShaderProgram> PendingProgram = std::nullopt; // a new shader program that is still being compiled
+    bool ShaderDirty = false; // the entries changed since PendingProgram was started
 
     struct calcEntry{
 	MyVec3 color;
 	std::string eq;
-	std::optional<std::variant<mathEngine::equation, std::shared_ptr<mathEngine::expr>>> parsedEq = std::nullopt;
-	std::optional<std::variant<mathEngine::equation, std::shared_ptr<mathEngine::expr>>> reducedEq = std::nullopt;
+	std::optional<parsedEqType> parsedEq = std::nullopt;
+	std::optional<parsedEqType> reducedEq = std::nullopt;
 	bool guiFocused = false;
+	unsigned int id = 0;
+	unsigned int revision = 0; //bumped on every edit, so that stale results from the symbolic worker are dropped
+	unsigned int appliedRevision = 0;
+	std::string shaderCode;
+	std::optional<analysis::curve> curve = std::nullopt;
     };
     std::list<calcEntry> entries;
+    unsigned int nextEntryId = 1;
     float viewZoom = 5.0f;
     float graphThickness = 2.0f;
     float majorLineThickness = 2.0f;
     float minorLineThickness = 1.0f;
 
+    analysis::engine analysisEngine;
+    bool showMarkers = true;
+
+    std::mutex symbolicMutex;
+    std::vector<symbolicResult> symbolicResults; //finished by the worker, waiting to be applied by Gui()
+    std::unordered_map<unsigned int, unsigned int> latestRevisions; //entry id -> newest submitted revision, so the worker can skip stale jobs
+    analysis::threadPool symbolicWorker{1}; //declared last, so it is joined before anything it uses is destroyed
+
     std::string genFragShader() const{
 	  std::string newFragShader;
 	  newFragShader += GFragShaderTop;
 	  for(const auto& entry : entries){
-		if(!entry.reducedEq)
+		if(entry.shaderCode.empty())
 			continue;
-		std::string codeEntry = "\t{\n";
-		codeEntry += "\t\tfloat val = ";
-		if(std::holds_alternative<mathEngine::equation>(*entry.reducedEq)){
-			codeEntry += std::get<mathEngine::equation>(*entry.reducedEq).getDiff()->toCode({"x", "y"}) + ";\n";
-			codeEntry += "\t\tif(abs(val) < EPSILON * " + std::to_string(graphThickness) + "){\n";
-		}else if(std::holds_alternative<std::shared_ptr<mathEngine::expr>>(*entry.reducedEq)){
-			auto& expr = std::get<std::shared_ptr<mathEngine::expr>>(*entry.reducedEq);
-			codeEntry += expr->toCode({"x"}) + ";\n"; //single exprs are treated as y=..., so no y terms allowed
-			auto derivativeTry = mathEngine::simplification::evaluateDerivative(expr->clone(), "x");
-			if(derivativeTry){
-				auto derivative = mathEngine::fullySimplify(*derivativeTry)->toCode({"x"});
-				codeEntry += "\t\tif(abs(y-val) < EPSILON * " + std::to_string(graphThickness) + " * max(abs(" + derivative + "), 1.0) ){\n";//note.  this maybe should be rethought for functions where the derivative isn't asways defined, for example Dx 1/x = ln(x) isn't defined for x < 0
-			}else{
-				codeEntry += "\t\tif(abs(y-val) < EPSILON * " + std::to_string(graphThickness) + "){\n";
-			}
-		}else{
-			continue;
-		}
+		std::string codeEntry = "\t{\n" + entry.shaderCode;
 		codeEntry += "\t\t\tcol = vec3(" + std::to_string(entry.color.x) + ", " + std::to_string(entry.color.y) + ", " + std::to_string(entry.color.z) + ");\n\t\t}\n\t}\n";
 		newFragShader += codeEntry;
 	  }
@@ -197,6 +260,68 @@ struct AppState
 	  return newFragShader;
     }
 
+    // Hands an edited entry to the symbolic worker
+    void submitEntry(calcEntry& entry){
+	  entry.revision++;
+	  {
+		std::lock_guard<std::mutex> lock(symbolicMutex);
+		latestRevisions[entry.id] = entry.revision;
+	  }
+	  symbolicWorker.submit([this, id = entry.id, revision = entry.revision, eq = entry.eq, thickness = graphThickness]{
+		{
+			//typing quickly queues a job per keystroke, only the newest one is worth running
+			std::lock_guard<std::mutex> lock(symbolicMutex);
+			auto latest = latestRevisions.find(id);
+			if(latest == latestRevisions.end() || latest->second != revision)
+				return;
+		}
+		symbolicResult output = runSymbolic(id, revision, eq, thickness);
+		std::lock_guard<std::mutex> lock(symbolicMutex);
+		symbolicResults.push_back(std::move(output));
+	  });
+    }
+
+    void forgetEntry(unsigned int id){
+	  std::lock_guard<std::mutex> lock(symbolicMutex);
+	  latestRevisions.erase(id);
+    }
+
+    // Moves finished worker results into their entries, returns true if any entry changed
+    bool applySymbolicResults(){
+	  std::vector<symbolicResult> finished;
+	  {
+		std::lock_guard<std::mutex> lock(symbolicMutex);
+		finished.swap(symbolicResults);
+	  }
+	  bool changed = false;
+	  for(auto& result : finished){
+		auto entry = std::find_if(entries.begin(), entries.end(), [&](const calcEntry& e){ return e.id == result.entryId; });
+		if(entry == entries.end() || entry->revision != result.revision)
+			continue;
+		entry->parsedEq = std::move(result.parsedEq);
+		entry->reducedEq = std::move(result.reducedEq);
+		entry->shaderCode = std::move(result.shaderCode);
+		entry->curve = std::move(result.curve);
+		entry->appliedRevision = result.revision;
+		changed = true;
+	  }
+	  return changed;
+    }
+
+    // Hands the compiled entries to the analysis engine, numbered like the gui labels
+    void updateAnalysisCurves(){
+	  std::vector<analysis::curve> curves;
+	  unsigned int entryIndex = 1;
+	  for(const auto& entry : entries){
+		if(entry.curve){
+			curves.push_back(*entry.curve);
+			curves.back().entryIndex = entryIndex;
+		}
+		entryIndex++;
+	  }
+	  analysisEngine.setCurves(std::move(curves));
+    }
+
     AppState()
     {
         Uniforms.AddUniform("viewStart", ImVec2{-2.5f, -2.5f});
@@ -218,7 +343,8 @@ struct AppState
 
 void InitAppResources3D(AppState& appState)
 {
-	appState.ShaderProgram = CreateShaderProgram(GVertexShaderSource, appState.genFragShader().c_str());
+	appState.VertexShader = CompileShader(GL_VERTEX_SHADER, GVertexShaderSource);
+	appState.ShaderProgram = FinishShaderProgram(StartShaderProgram(appState.VertexShader, appState.genFragShader().c_str()));
 	appState.FullScreenQuadVAO = CreateFullScreenQuadVAO();
 	appState.StoreUniformLocations();
 }
@@ -227,6 +353,9 @@ void InitAppResources3D(AppState& appState)
 void DestroyAppResources3D(AppState& appState)
 {
     glDeleteProgram(appState.ShaderProgram);
+    if(appState.PendingProgram)
+        DiscardShaderProgram(*appState.PendingProgram);
+    glDeleteShader(appState.VertexShader);
     glDeleteVertexArrays(1, &appState.FullScreenQuadVAO);
 }
 
@@ -272,6 +401,53 @@ void CustomBackground(AppState& appState)
 }
 
 
+// Draws the roots/extrema/intersections found by the analysis engine on top of the shader
+void DrawAnalysisMarkers(AppState& appState, ImVec2 viewStart, ImVec2 viewSize)
+{
+    auto analysisResult = appState.analysisEngine.request({viewStart.x, viewStart.y, viewSize.x, viewSize.y});
+    if(analysisResult)
+	    ImGui::Text("Markers: %zu (%.2f ms)", analysisResult->markers.size(), analysisResult->computeMs);
+    if(!analysisResult || !appState.showMarkers)
+	    return;
+
+    std::vector<ImU32> entryColors = {0};
+    for(const auto& entry : appState.entries)
+	    entryColors.push_back(ImGui::ColorConvertFloat4ToU32(ImVec4(entry.color.x, entry.color.y, entry.color.z, 1.0f)));
+
+    //markers are drawn in imgui coordinates (points), not in scaled pixels
+    auto& io = ImGui::GetIO();
+    auto drawList = ImGui::GetBackgroundDrawList();
+    float radius = HelloImGui::EmSize(0.3f);
+    ImVec2 mousePos = ImGui::GetMousePos();
+    for(const auto& marker : analysisResult->markers){
+	    ImVec2 screenPos = {(float)((marker.x - viewStart.x) / viewSize.x) * io.DisplaySize.x, (1.0f - (float)((marker.y - viewStart.y) / viewSize.y)) * io.DisplaySize.y};
+	    if(screenPos.x < -radius || screenPos.y < -radius || screenPos.x > io.DisplaySize.x + radius || screenPos.y > io.DisplaySize.y + radius)
+		    continue;
+	    ImU32 color = marker.entryA < entryColors.size() ? entryColors[marker.entryA] : IM_COL32(0, 0, 0, 255);
+	    if(marker.type == analysis::markerType::intersection)
+		    color = IM_COL32(40, 40, 40, 255);
+	    drawList->AddCircleFilled(screenPos, radius, color);
+	    drawList->AddCircle(screenPos, radius, IM_COL32(255, 255, 255, 255));
+
+	    float dx = mousePos.x - screenPos.x;
+	    float dy = mousePos.y - screenPos.y;
+	    if(dx * dx + dy * dy < radius * radius * 4.0f){
+		    switch(marker.type){
+			    case analysis::markerType::root:
+				    ImGui::SetTooltip("Root of entry %u\n(%g, %g)", marker.entryA, marker.x, marker.y);
+				    break;
+			    case analysis::markerType::extremum:
+				    ImGui::SetTooltip("Extremum of entry %u\n(%g, %g)", marker.entryA, marker.x, marker.y);
+				    break;
+			    case analysis::markerType::intersection:
+				    ImGui::SetTooltip("Intersection of entries %u and %u\n(%g, %g)", marker.entryA, marker.entryB, marker.x, marker.y);
+				    break;
+		    }
+	    }
+    }
+}
+
+
 void Gui(AppState& appState)
 {
     ImGui::SetNextWindowPos(HelloImGui::EmToVec2(0.0f, 0.0f), ImGuiCond_Always);
@@ -326,31 +502,20 @@ void Gui(AppState& appState)
     viewSize = ImVec2(appState.viewZoom, appState.viewZoom * (ScaledDisplaySize().y / ScaledDisplaySize().x));
 
     ImGui::Text("FPS: %.1f", HelloImGui::FrameRate());
+    ImGui::Checkbox("Show roots/extrema/intersections", &appState.showMarkers);
 
     bool someEntryChanged = false;
+    bool someCurveChanged = false; //only set when an expression (or the entry numbering) changes, not for colors
     //note:  the entryNum names are matching so focus stays after inputting a new eq
     unsigned int entryNum = 1;
     for(auto& entry : appState.entries){
 	    if(ImGui::InputText(("entry " + std::to_string(entryNum) + "###entryNum" + std::to_string(entryNum)).c_str(), &entry.eq)){
-		    //try to compile the new code
-		    auto parsed = parser::ptParse::parse(entry.eq);
-		    if(parsed){
-			    entry.parsedEq = parsed->value;
-			    if(std::holds_alternative<mathEngine::equation>(*entry.parsedEq)){
-				const auto& eq = std::get<mathEngine::equation>(*entry.parsedEq);
-				entry.reducedEq = mathEngine::fullySimplify(eq.clone());	
-			    }
-			    if(std::holds_alternative<std::shared_ptr<mathEngine::expr>>(*entry.parsedEq)){
-				const auto& eq = std::get<std::shared_ptr<mathEngine::expr>>(*entry.parsedEq);
-				entry.reducedEq = mathEngine::fullySimplify(eq->clone());	
-			    }
-		    }else{
-			entry.parsedEq = std::nullopt;
-			entry.reducedEq = std::nullopt;
-		    }
-		    someEntryChanged = true;
+		    //parse/simplify on the symbolic worker, the results get applied once they're done
+		    appState.submitEntry(entry);
 	    }
 	    entry.guiFocused = ImGui::IsItemFocused();//make ImGuiTextEditCallbackData* datasure to delete entries only if they are not being currently worked on
+	    if(entry.appliedRevision != entry.revision)
+		    ImGui::TextDisabled("Working...");
 	    if(entry.parsedEq){
 		    if(std::holds_alternative<mathEngine::equation>(*entry.parsedEq))
 			    ImGui::Text("Parsed input: %s", std::get<mathEngine::equation>(*entry.parsedEq).toLatex().c_str());
@@ -375,41 +540,51 @@ void Gui(AppState& appState)
     if(!next.empty()){
 		appState.entries.push_back({MyVec3{1, 0, 1}, next});
 		auto& entry = appState.entries.back();
+		entry.id = appState.nextEntryId++;
 		next.clear();
-		auto parsed = parser::ptParse::parse(entry.eq);
-		if(parsed){
-			entry.parsedEq = parsed->value;
-			if(std::holds_alternative<mathEngine::equation>(*entry.parsedEq)){
-				const auto& eq = std::get<mathEngine::equation>(*entry.parsedEq);
-				entry.reducedEq = mathEngine::fullySimplify(eq.clone());
-			}
-			if(std::holds_alternative<std::shared_ptr<mathEngine::expr>>(*entry.parsedEq)){
-				const auto& eq = std::get<std::shared_ptr<mathEngine::expr>>(*entry.parsedEq);
-				entry.reducedEq = mathEngine::fullySimplify(eq->clone());
-			}
-		}else{
-			entry.parsedEq = std::nullopt;
-			entry.reducedEq = std::nullopt;
-		}
-		someEntryChanged = true;
+		appState.submitEntry(entry);
 	}
 
+    if(appState.applySymbolicResults()){
+	    someEntryChanged = true;
+	    someCurveChanged = true;
+    }
+
     std::erase_if(appState.entries, [&](const auto& entry)mutable{
 		    if(entry.eq.empty() && !entry.guiFocused){
+			appState.forgetEntry(entry.id);
 			someEntryChanged = true;
+			someCurveChanged = true;
 			return true;
 		    }else{
 			return false;
 		    }});
 
-    if(someEntryChanged){
-	  std::string newFragShader = appState.genFragShader();
-	  std::cout<<"Recompiling shader: "<<newFragShader<<std::endl;
-  	  appState.ShaderProgram = CreateShaderProgram(GVertexShaderSource, newFragShader.c_str());
+    //a program started on an earlier frame is swapped in once the driver is done with it, so linking never blocks a frame
+    if(appState.PendingProgram && IsShaderProgramReady(*appState.PendingProgram)){
+	  glDeleteProgram(appState.ShaderProgram);
+	  appState.ShaderProgram = FinishShaderProgram(*appState.PendingProgram);
+	  appState.PendingProgram = std::nullopt;
 	  appState.StoreUniformLocations();
 	  appState.ApplyUniforms();
     }
 
+    //only one program compiles at a time: restarting it on every change (e.g. each frame of a color drag) would mean
+    //it never finishes, so changes made meanwhile are picked up once it has been swapped in
+    if(someEntryChanged)
+	  appState.ShaderDirty = true;
+    if(appState.ShaderDirty && !appState.PendingProgram){
+	  std::string newFragShader = appState.genFragShader();
+	  std::cout<<"Recompiling shader: "<<newFragShader<<std::endl;
+	  appState.PendingProgram = StartShaderProgram(appState.VertexShader, newFragShader.c_str());
+	  appState.ShaderDirty = false;
+    }
+    //setting the curves drops the analysis cache, so a color change must not do it
+    if(someCurveChanged)
+	  appState.updateAnalysisCurves();
+
+    DrawAnalysisMarkers(appState, viewStart, viewSize);
+
     /*
     //draw labels to background
     auto bgDrawList = ImGui::GetForegroundDrawList();
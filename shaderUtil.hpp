@@ -2,6 +2,7 @@
 #include "hello_imgui/hello_imgui.h"
 #include <iostream>
 #include <memory>
+#include <string_view>
 #include <unordered_map>
 
 struct MyVec3{float x,y,z;};
@@ -192,25 +193,75 @@ inline GLuint CreateFullScreenQuadVAO()
     return vao;
 }
 
-inline GLuint CreateShaderProgram(const char* vertexShaderSource, const char* fragmentShaderSource)
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
+inline bool HasGlExtension(const char* name)
+{
+    GLint count = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+    for (GLint i = 0; i < count; ++i)
+    {
+        const char* extension = (const char*)glGetStringi(GL_EXTENSIONS, i);
+        if (extension && std::string_view(extension) == name)
+            return true;
+    }
+    return false;
+}
+
+// A shader program whose compilation / link status has not been queried yet
+struct PendingShaderProgram
+{
+    GLuint program = 0;
+    GLuint fragmentShader = 0;
+};
+
+// Starts compiling and linking without asking for the result: drivers (and browsers especially)
+// only block once a status is queried, so the actual work can overlap with the next frames.
+// The vertex shader never changes, so it is compiled once (with CompileShader) and shared
+inline PendingShaderProgram StartShaderProgram(GLuint vertexShader, const char* fragmentShaderSource)
+{
+    PendingShaderProgram pending;
+    pending.fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
+    glShaderSource(pending.fragmentShader, 1, &fragmentShaderSource, NULL);
+    glCompileShader(pending.fragmentShader);
+
+    pending.program = glCreateProgram();
+    glAttachShader(pending.program, vertexShader);
+    glAttachShader(pending.program, pending.fragmentShader);
+    glLinkProgram(pending.program);
+    return pending;
+}
+
+// With KHR_parallel_shader_compile this can be polled without blocking.
+// Without it, there is nothing to poll, so the program is simply finished on the frame after it was started.
+inline bool IsShaderProgramReady(const PendingShaderProgram& pending)
 {
-    GLuint vertexShader = CompileShader(GL_VERTEX_SHADER, vertexShaderSource);
-    GLuint fragmentShader = CompileShader(GL_FRAGMENT_SHADER, fragmentShaderSource);
+    static bool hasParallelCompile = HasGlExtension("GL_KHR_parallel_shader_compile");
+    if (!hasParallelCompile)
+        return true;
+    GLint isComplete = GL_FALSE;
+    glGetProgramiv(pending.program, GL_COMPLETION_STATUS_KHR, &isComplete);
+    return isComplete == GL_TRUE;
+}
 
-    // Create shader program
-    GLuint shaderProgram = glCreateProgram();
-    glAttachShader(shaderProgram, vertexShader);
-    glAttachShader(shaderProgram, fragmentShader);
-    glLinkProgram(shaderProgram);
-    FailOnShaderLinkError(shaderProgram);
+inline GLuint FinishShaderProgram(const PendingShaderProgram& pending)
+{
+    FailOnShaderCompileError(pending.fragmentShader);
+    FailOnShaderLinkError(pending.program);
 
-    // Delete shader objects once linked
-    glDeleteShader(vertexShader);
-    glDeleteShader(fragmentShader);
+    // Delete the fragment shader once linked, the shared vertex shader stays around for the next program
+    glDeleteShader(pending.fragmentShader);
 
     // Check for any OpenGL errors
     FailOnOpenGlError();
 
-    return shaderProgram;
+    return pending.program;
 }
 
+inline void DiscardShaderProgram(const PendingShaderProgram& pending)
+{
+    glDeleteShader(pending.fragmentShader);
+    glDeleteProgram(pending.program);
+}